@@ -24,8 +24,15 @@ struct Token {
   long val;        // kindがTK_NUMの場合、その数値
   char *loc;       // トークン文字列 Token location
   int len;         // Token length
+  int line_no;     // Line number
 };
 
+// Tokens are carved out of blocks this big. One calloc per token used
+// to cost more than scanning the token's bytes.
+#define TOKEN_BLOCK 1024
+
+extern char *opt_lex;
+
 // プロトタイプ宣言
 bool equal(Token*, char*);
 Token *skip(Token*, char*);
@@ -63,6 +70,7 @@ typedef enum {
   ND_EXPR_STMT, // Expression statement
   ND_VAR, // Variable
   ND_NUM, // Integer
+  ND_NUM_KINDS, // Number of node kinds; keep last
 } NodeKind;
 
 // AST node type
@@ -70,6 +78,7 @@ typedef struct Node Node;
 struct Node {
   NodeKind kind; // Node kind
   Node *next;    // Next node
+  Token *tok;    // Representative token
   Node *lhs;     // Left-hand side
   Node *rhs;     // Right-hand side
 
@@ -83,6 +92,9 @@ struct Node {
   // Block
   Node *body;
 
+  // First profile counter of "if" and "for"
+  int prof_id;
+
   // Function call
   char *funcname;
   Node *args;
@@ -100,9 +112,53 @@ struct Function {
 };
 
 Function *parse(Token *tok);
+void visit_nodes(Node *node, void (*fn)(Node *node, void *arg), void *arg);
+
+//
+// main.c
+//
+
+extern char *input_path;
 
 //
 // codegen.c
 //
 
-void codegen(Function *prog);
+extern char *opt_profile_generate;
+extern char *opt_profile_use;
+
+void codegen(Function *prog, FILE *out);
+
+//
+// stats.c
+//
+
+// Compiler phases timed by --stats.
+typedef enum {
+  PH_TOKENIZE,
+  PH_PARSE,
+  PH_OFFSETS,
+  PH_CODEGEN,
+  PH_NUM,
+} Phase;
+
+extern bool opt_stats;
+extern bool opt_stats_json;
+
+void stats_begin(Phase ph);
+void stats_end(Phase ph);
+void stats_insn(void);
+void stats_label(void);
+void stats_report(char *input, Token *tok, Function *prog);
+
+//
+// cache.c
+//
+
+extern char *opt_cache_dir;
+extern long opt_cache_max_size;
+
+char *cache_default_dir(void);
+bool cache_lookup(char *input, FILE *out);
+void cache_store(char *buf, size_t len);
+void cache_print_stats(void);
@@ -0,0 +1,120 @@
+#!/bin/bash
+# Compiler throughput benchmark. `make bench` builds ./9cc and bench/gen
+# and runs this script.
+#
+# Each row scales one axis of bench/gen while the others stay at their
+# defaults, compiles the program RUNS times with --stats=json and reports
+# the median of each phase. "spread" is (max-min)/median of the total
+# wall time, so noisy rows are easy to spot.
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=${RUNS:-7}
+GEN=bench/gen
+CC9=./9cc
+SRC=bench/tmp-bench.9cc
+
+# Prints a phase's wall time in ms from one --stats=json line.
+phase_ms() {
+  grep -o "\"$1\": {\"wall_ms\": [0-9.]*" | sed 's/.*: //'
+}
+
+field() {
+  grep -o "\"$1\": [0-9]*" | head -1 | sed 's/.*: //'
+}
+
+median() {
+  sort -g | awk '{ a[NR] = $1 } END { print a[int((NR + 1) / 2)] }'
+}
+
+spread() {
+  sort -g | awk '{ a[NR] = $1 } END {
+    m = a[int((NR + 1) / 2)]
+    printf "%.1f%%", (m > 0) ? (a[NR] - a[1]) / m * 100 : 0
+  }'
+}
+
+run() {
+  local label="$1"
+  shift
+  $GEN "$@" > $SRC
+
+  # Warm up the page cache and the binary once before measuring.
+  $CC9 $FLAGS - < $SRC > /dev/null || exit 1
+
+  local tok=() par=() cg=() tot=() stats
+  for ((i = 0; i < RUNS; i++)); do
+    stats=$($CC9 $FLAGS --stats=json - < $SRC 2>&1 > /dev/null)
+    tok+=("$(phase_ms tokenize <<< "$stats")")
+    par+=("$(phase_ms parse <<< "$stats")")
+    cg+=("$(phase_ms codegen <<< "$stats")")
+    tot+=("$(phase_ms total <<< "$stats")")
+  done
+
+  local bytes nodes
+  bytes=$(field input_bytes <<< "$stats")
+  nodes=$(field nodes <<< "$stats")
+
+  local t p c w s
+  t=$(printf '%s\n' "${tok[@]}" | median)
+  p=$(printf '%s\n' "${par[@]}" | median)
+  c=$(printf '%s\n' "${cg[@]}" | median)
+  w=$(printf '%s\n' "${tot[@]}" | median)
+  s=$(printf '%s\n' "${tot[@]}" | spread)
+
+  awk -v l="$label" -v b="$bytes" -v n="$nodes" \
+      -v t="$t" -v p="$p" -v c="$c" -v w="$w" -v s="$s" 'BEGIN {
+    tok = (t > 0) ? b / t / 1e3 : 0
+    par = (p > 0) ? n / p * 1e3 : 0
+    cg = (c > 0) ? n / c * 1e3 : 0
+    tot = (w > 0) ? b / w / 1e3 : 0
+    printf "%-18s %9d %9d %10.1f %12.0f %12.0f %10.1f %9.3f %7s\n",
+      l, b, n, tok, par, cg, tot, w, s
+  }'
+}
+
+header() {
+  echo
+  echo "== $1 =="
+  printf "%-18s %9s %9s %10s %12s %12s %10s %9s %7s\n" \
+    config bytes nodes "tok MB/s" "parse nod/s" "cg nod/s" "total MB/s" \
+    "total ms" spread
+}
+
+echo "9cc throughput benchmark, median of $RUNS runs"
+
+header "statement count"
+for n in 1000 4000 16000 64000; do
+  run "stmts=$n" -s $n
+done
+
+header "expression depth"
+for n in 1 4 16 64; do
+  run "depth=$n" -s 4000 -d $n
+done
+
+header "locals count"
+for n in 4 32 128 512; do
+  run "locals=$n" -s 4000 -l $n
+done
+
+header "loop nesting"
+for n in 0 2 8 32; do
+  run "nest=$n" -s 4000 -n $n
+done
+
+header "call density"
+for n in 0 10 50 100; do
+  run "calls=$n%" -s 4000 -c $n
+done
+
+# Lexer microbenchmark: the same inputs through each scanner. Only the
+# "tok MB/s" column differs between rows of a pair.
+header "lexer scanners"
+for input in "plain:-s 64000" "long-runs:-s 16000 -w 64 -i 32"; do
+  for lex in scalar sse2 avx2; do
+    $CC9 --lex=$lex '{ return 0; }' > /dev/null 2>&1 || continue
+    FLAGS=--lex=$lex run "${input%%:*}/$lex" ${input#*:}
+  done
+done
+
+rm -f $SRC
@@ -0,0 +1,356 @@
+// Generated-code quality benchmark. `make bench-code` runs it.
+//
+// Every kernel below is compiled three ways: with 9cc, and as C with
+// `gcc -O0` and `gcc -O2`. Each binary is run RUNS times (default 11)
+// and the median is reported, using the cycles and instructions
+// hardware counters from perf_event_open when the kernel allows it and
+// wall-clock time otherwise. The static number of instructions in each
+// assembly file is reported too, and the exit codes are cross-checked so
+// a miscompilation can't look like a speedup.
+//
+// In the C version, loop bounds and initial values go through opaque(),
+// an empty asm that hides each value from gcc, so gcc can't compute a
+// loop's trip count or result at compile time. An -O2 build smaller
+// than MIN_O2_INSNS is flagged as folded anyway.
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TMP "bench/tmp-code"
+
+// gcc -O2 folding a kernel to a constant leaves about this many
+// instructions.
+#define MIN_O2_INSNS 8
+
+typedef struct {
+  char *name;
+  char *decls; // C declarations for the variables the body uses
+  char *body;  // 9cc program; also a valid C block
+} Kernel;
+
+static Kernel kernels[] = {
+  {"sum", "long s, i;",
+   "{ s=0; for (i=0; i<30000000; i=i+1) s=s+i; return s/1000000; }"},
+
+  {"nested", "long s, i, j;",
+   "{ s=0; for (i=0; i<3000; i=i+1) for (j=0; j<3000; j=j+1)"
+   " s=s+i*j/(j+1); return s/1000; }"},
+
+  {"poly", "long s, x, y;",
+   "{ s=0; for (x=0; x<10000000; x=x+1) { y=((3*x+5)*x+7)/(x+1);"
+   " s=s+y-y/7*7; } return s; }"},
+
+  {"ptr_chase", "long x, i; long *y; long **z;",
+   "{ x=0; y=&x; z=&y; for (i=0; i<20000000; i=i+1) **z=**z+i;"
+   " return x/1000000; }"},
+
+  {"collatz", "long steps, k, n;",
+   "{ steps=0; for (k=1; k<300000; k=k+1) { n=k; while (n!=1) {"
+   " if (n/2*2==n) n=n/2; else n=3*n+1; steps=steps+1; } }"
+   " return steps/1000; }"},
+
+  {"fib_mod", "long a, b, c, i;",
+   "{ a=0; b=1; for (i=0; i<30000000; i=i+1) { c=a+b; a=b;"
+   " b=c-c/1000000007*1000000007; } return a; }"},
+};
+
+typedef struct {
+  double wall; // Seconds
+  long cycles;
+  long insns;
+  int status;
+} Sample;
+
+static int runs = 11;
+static bool have_perf = true;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_cmd(char *fmt, ...) {
+  char cmd[1024];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(cmd, sizeof(cmd), fmt, ap);
+  va_end(ap);
+
+  if (system(cmd) != 0) {
+    fprintf(stderr, "codebench: command failed: %s\n", cmd);
+    exit(1);
+  }
+}
+
+static void write_file(char *path, char *fmt, ...) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    perror(path);
+    exit(1);
+  }
+
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(fp, fmt, ap);
+  va_end(ap);
+  fclose(fp);
+}
+
+// Writes the C version of a kernel body: every integer literal after
+// `<`, or after `=` and followed by `;`, i.e. every loop bound and
+// initial value, becomes `opaque(N)`.
+static void write_c_body(FILE *fp, char *body) {
+  for (char *p = body; *p;) {
+    if (isdigit(*p)) {
+      char *q = p;
+      while (isdigit(*q))
+        q++;
+
+      bool bound = p > body && p[-1] == '<';
+      bool init = p > body + 1 && p[-1] == '=' && !strchr("=!<", p[-2]) &&
+                  *q == ';';
+      if (bound || init)
+        fprintf(fp, "opaque(%.*s)", (int)(q - p), p);
+      else
+        fprintf(fp, "%.*s", (int)(q - p), p);
+      p = q;
+      continue;
+    }
+    fputc(*p++, fp);
+  }
+}
+
+static void write_c_kernel(char *path, Kernel *k) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    perror(path);
+    exit(1);
+  }
+
+  fprintf(fp, "static inline long opaque(long x) {\n");
+  fprintf(fp, "  __asm__(\"\" : \"+r\"(x));\n");
+  fprintf(fp, "  return x;\n");
+  fprintf(fp, "}\n\n");
+  fprintf(fp, "int main() {\n");
+  fprintf(fp, "  %s\n  ", k->decls);
+  write_c_body(fp, k->body);
+  fprintf(fp, "\n}\n");
+  fclose(fp);
+}
+
+// Counts instructions in an assembly file: indented lines that are not
+// directives.
+static int count_insns(char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    perror(path);
+    exit(1);
+  }
+
+  char line[1024];
+  int n = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] != ' ' && line[0] != '\t')
+      continue;
+    char *p = line + strspn(line, " \t");
+    if (*p && *p != '.' && *p != '\n' && *p != '#')
+      n++;
+  }
+
+  fclose(fp);
+  return n;
+}
+
+// Opens a hardware counter for `pid` that starts counting when the
+// process execs. Returns -1 if the kernel doesn't let us.
+static int perf_open(int config, pid_t pid) {
+  struct perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static long perf_read(int fd) {
+  long val = 0;
+  if (fd < 0 || read(fd, &val, sizeof(val)) != sizeof(val))
+    return -1;
+  close(fd);
+  return val;
+}
+
+// Runs `path` once. The child blocks on a pipe until the counters are
+// attached so that only the exec'd binary is measured.
+static Sample run_once(char *path) {
+  int go[2];
+  if (pipe(go) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1)
+      _exit(127);
+    execl(path, path, (char *)NULL);
+    _exit(127);
+  }
+  close(go[0]);
+
+  int cyc = -1, ins = -1;
+  if (have_perf) {
+    cyc = perf_open(PERF_COUNT_HW_CPU_CYCLES, pid);
+    ins = perf_open(PERF_COUNT_HW_INSTRUCTIONS, pid);
+    if (cyc < 0 || ins < 0) {
+      have_perf = false;
+      fprintf(stderr, "codebench: perf_event_open unavailable, "
+              "falling back to wall-clock time\n");
+    }
+  }
+
+  Sample s = {};
+  double start = now();
+  if (write(go[1], "x", 1) != 1) {
+    perror("write");
+    exit(1);
+  }
+  close(go[1]);
+
+  int status;
+  waitpid(pid, &status, 0);
+  s.wall = now() - start;
+  s.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  s.cycles = perf_read(cyc);
+  s.insns = perf_read(ins);
+  return s;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(double *)a, y = *(double *)b;
+  return (x > y) - (x < y);
+}
+
+static double median(double *v, int n) {
+  qsort(v, n, sizeof(*v), cmp_double);
+  return v[n / 2];
+}
+
+typedef struct {
+  int static_insns;
+  int status;
+  double wall;
+  double cycles;
+  double insns;
+} Result;
+
+static Result measure(char *path, char *asm_path) {
+  double wall[runs], cycles[runs], insns[runs];
+  Result r = {};
+  r.static_insns = count_insns(asm_path);
+
+  for (int i = 0; i < runs; i++) {
+    Sample s = run_once(path);
+    if (i > 0 && s.status != r.status) {
+      fprintf(stderr, "codebench: %s: nondeterministic exit code\n", path);
+      exit(1);
+    }
+    r.status = s.status;
+    wall[i] = s.wall;
+    cycles[i] = s.cycles;
+    insns[i] = s.insns;
+  }
+
+  r.wall = median(wall, runs);
+  r.cycles = median(cycles, runs);
+  r.insns = median(insns, runs);
+  return r;
+}
+
+static void print_row(char *kernel, char *cc, Result *r, Result *base) {
+  if (have_perf)
+    printf("%-10s %-8s %8d %14.0f %14.0f %8.2f %9.3f %7.2fx\n",
+           kernel, cc, r->static_insns, r->cycles, r->insns,
+           r->insns / r->cycles, r->wall * 1e3, r->cycles / base->cycles);
+  else
+    printf("%-10s %-8s %8d %14s %14s %8s %9.3f %7.2fx\n",
+           kernel, cc, r->static_insns, "-", "-", "-",
+           r->wall * 1e3, r->wall / base->wall);
+}
+
+int main(int argc, char **argv) {
+  if (getenv("RUNS"))
+    runs = atoi(getenv("RUNS"));
+  if (runs < 1)
+    runs = 1;
+
+  run_cmd("mkdir -p " TMP);
+
+  printf("generated code benchmark, median of %d runs, "
+         "ratio relative to gcc -O2\n\n", runs);
+  printf("%-10s %-8s %8s %14s %14s %8s %9s %8s\n", "kernel", "compiler",
+         "insns", "cycles", "retired", "IPC", "wall ms", "ratio");
+
+  int total[3] = {};
+  bool folded = false;
+  for (int i = 0; i < sizeof(kernels) / sizeof(*kernels); i++) {
+    Kernel *k = &kernels[i];
+
+    write_file(TMP "/k.9cc", "%s\n", k->body);
+    write_c_kernel(TMP "/k.c", k);
+
+    run_cmd("./9cc - < " TMP "/k.9cc > " TMP "/k9.s");
+    run_cmd("gcc -static -o " TMP "/k9 " TMP "/k9.s");
+    run_cmd("gcc -O0 -S -o " TMP "/k0.s " TMP "/k.c");
+    run_cmd("gcc -static -o " TMP "/k0 " TMP "/k0.s");
+    run_cmd("gcc -O2 -S -o " TMP "/k2.s " TMP "/k.c");
+    run_cmd("gcc -static -o " TMP "/k2 " TMP "/k2.s");
+
+    Result r2 = measure(TMP "/k2", TMP "/k2.s");
+    Result r0 = measure(TMP "/k0", TMP "/k0.s");
+    Result r9 = measure(TMP "/k9", TMP "/k9.s");
+
+    if (r9.status != r0.status || r9.status != r2.status) {
+      fprintf(stderr, "codebench: %s: exit codes differ: "
+              "9cc=%d gcc-O0=%d gcc-O2=%d\n",
+              k->name, r9.status, r0.status, r2.status);
+      return 1;
+    }
+
+    if (r2.static_insns < MIN_O2_INSNS) {
+      fprintf(stderr, "codebench: %s: gcc -O2 build has only %d "
+              "instructions; was the kernel constant-folded?\n",
+              k->name, r2.static_insns);
+      folded = true;
+    }
+
+    print_row(k->name, "9cc", &r9, &r2);
+    print_row(k->name, "gcc-O0", &r0, &r2);
+    print_row(k->name, "gcc-O2", &r2, &r2);
+
+    total[0] += r9.static_insns;
+    total[1] += r0.static_insns;
+    total[2] += r2.static_insns;
+  }
+
+  printf("\nstatic instructions: 9cc %d, gcc-O0 %d, gcc-O2 %d\n",
+         total[0], total[1], total[2]);
+
+  run_cmd("rm -rf " TMP);
+  return folded;
+}
@@ -0,0 +1,142 @@
+// Synthetic program generator for the compiler throughput benchmark.
+//
+// Writes a 9cc program to stdout. Each knob scales one axis of the
+// input independently so a regression can be pinned to the phase that
+// handles it:
+//
+//   -s N  number of statements
+//   -d N  binary operators per expression
+//   -l N  number of distinct local variables
+//   -n N  loop nesting depth around every group of statements
+//   -c N  percentage of expression operands that are function calls
+//   -w N  extra indentation on every line
+//   -i N  minimum length of variable names
+//   -r N  random seed
+//
+// Expressions are left-deep chains so they never need more than a
+// handful of the six scratch registers codegen has.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int stmts = 1000;
+static int depth = 4;
+static int nlocals = 8;
+static int nest = 0;
+static int calls = 0;
+static int pad = 0;
+static int idw = 0;
+static unsigned long seed = 1;
+
+// Small xorshift PRNG so output is identical on every platform.
+static unsigned long next(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+static int rnd(int n) {
+  return next() % n;
+}
+
+static void operand(void) {
+  if (rnd(100) < calls) {
+    switch (rnd(3)) {
+    case 0:
+      printf("ret3()");
+      return;
+    case 1:
+      printf("add(v%0*d, %d)", idw, rnd(nlocals), rnd(100));
+      return;
+    default:
+      printf("sub(v%0*d, v%0*d)", idw, rnd(nlocals), idw, rnd(nlocals));
+      return;
+    }
+  }
+
+  if (rnd(3) == 0)
+    printf("%d", rnd(1000) + 1);
+  else
+    printf("v%0*d", idw, rnd(nlocals));
+}
+
+static void expr(void) {
+  static char *op[] = {"+", "-", "*", "/"};
+
+  operand();
+  for (int i = 0; i < depth; i++) {
+    printf(" %s ", op[rnd(4)]);
+    operand();
+  }
+}
+
+static void stmt(int indent) {
+  printf("%*s", pad + indent, "");
+
+  if (rnd(8) == 0) {
+    printf("if (");
+    expr();
+    printf(" < %d) v%0*d = ", rnd(1000), idw, rnd(nlocals));
+    expr();
+    printf("; else v%0*d = ", idw, rnd(nlocals));
+    expr();
+    printf(";\n");
+    return;
+  }
+
+  printf("v%0*d = ", idw, rnd(nlocals));
+  expr();
+  printf(";\n");
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: gen [-s stmts] [-d depth] [-l locals] "
+          "[-n nest] [-c call%%] [-w indent] [-i idlen] [-r seed]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+      usage();
+
+    long val = strtol(argv[++i], NULL, 10);
+    switch (argv[i - 1][1]) {
+    case 's': stmts = val; break;
+    case 'd': depth = val; break;
+    case 'l': nlocals = val; break;
+    case 'n': nest = val; break;
+    case 'c': calls = val; break;
+    case 'w': pad = val; break;
+    case 'i': idw = val > 1 ? val - 1 : 0; break;
+    case 'r': seed = val ? val : 1; break;
+    default: usage();
+    }
+  }
+
+  if (nlocals < 1)
+    nlocals = 1;
+
+  printf("{\n");
+  for (int i = 0; i < nlocals; i++)
+    printf("%*sv%0*d = %d;\n", pad + 2, "", idw, i, i + 1);
+
+  // Statements are emitted in groups of eight, each group wrapped in
+  // `nest` loops.
+  for (int i = 0; i < stmts; i += 8) {
+    for (int j = 0; j < nest; j++)
+      printf("%*sfor (l%d = 0; l%d < 2; l%d = l%d + 1) {\n",
+             pad + 2 + j * 2, "", j, j, j, j);
+
+    for (int j = i; j < i + 8 && j < stmts; j++)
+      stmt(2 + nest * 2);
+
+    for (int j = nest - 1; j >= 0; j--)
+      printf("%*s}\n", pad + 2 + j * 2, "");
+  }
+
+  printf("%*sreturn v%0*d;\n", pad + 2, "", idw, 0);
+  printf("}\n");
+  return 0;
+}
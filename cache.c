@@ -0,0 +1,367 @@
+#include "9cc.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Content-addressed compilation cache.
+//
+// An entry is the assembly for one input, stored as DIR/xx/yyyy.s where
+// xxyyyy is a 128-bit hash of the input text, the file name that goes
+// into .file, the profile options and profile, and the identity of the
+// 9cc binary itself. Entries are written to a temporary file and renamed
+// into place, so concurrent compiles never see a partial entry. When the
+// cache grows past its size limit, the least recently used entries are
+// deleted. DIR/stats keeps the hit and miss counters and is only updated
+// under an fcntl lock.
+//
+// The cache is best effort: if anything fails, 9cc just compiles.
+
+char *opt_cache_dir;
+long opt_cache_max_size = 64 * 1024 * 1024;
+
+// A temporary file older than this belongs to a compile that died
+// before renaming it into place.
+#define STALE_TMP_SECONDS 300
+
+static char key[33];
+
+// Hashes 8 bytes at a time in two independent lanes.
+static void hash(uint64_t h[2], char *p, size_t len) {
+  static const uint64_t k0 = 0x9e3779b97f4a7c15;
+  static const uint64_t k1 = 0xc2b2ae3d27d4eb4f;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h[0] = ((h[0] ^ w) * k0);
+    h[0] ^= h[0] >> 29;
+    h[1] = ((h[1] ^ w) * k1);
+    h[1] ^= h[1] >> 31;
+  }
+
+  uint64_t w = len;
+  memcpy(&w, p, len);
+  w ^= (uint64_t)len << 56;
+  h[0] = ((h[0] ^ w) * k0);
+  h[0] ^= h[0] >> 29;
+  h[1] = ((h[1] ^ w) * k1);
+  h[1] ^= h[1] >> 31;
+}
+
+static void hash_str(uint64_t h[2], char *s) {
+  hash(h, s, strlen(s) + 1);
+}
+
+static void hash_long(uint64_t h[2], long val) {
+  hash(h, (char *)&val, sizeof(val));
+}
+
+// Hashes the contents of a file, or nothing if it can't be read.
+static void hash_file(uint64_t h[2], char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return;
+
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    hash(h, buf, n);
+  fclose(fp);
+}
+
+// Computes the cache key of `input`. The 9cc binary is identified by its
+// size and modification time, so rebuilding the compiler starts a fresh
+// set of entries. Options that change the output are part of the key.
+static void compute_key(char *input) {
+  uint64_t h[2] = {0x243f6a8885a308d3, 0x13198a2e03707344};
+
+  struct stat st;
+  if (stat("/proc/self/exe", &st) == 0) {
+    hash_long(h, st.st_size);
+    hash_long(h, st.st_mtim.tv_sec);
+    hash_long(h, st.st_mtim.tv_nsec);
+  }
+
+  hash_str(h, input_path);
+  hash_str(h, opt_profile_generate ? opt_profile_generate : "");
+  hash_str(h, opt_profile_use ? opt_profile_use : "");
+  if (opt_profile_use)
+    hash_file(h, opt_profile_use);
+  hash(h, input, strlen(input));
+  snprintf(key, sizeof(key), "%016lx%016lx", (long)h[0], (long)h[1]);
+}
+
+// Returns $XDG_CACHE_HOME/9cc or ~/.cache/9cc.
+char *cache_default_dir(void) {
+  char *buf = NULL;
+  size_t len;
+  FILE *out = open_memstream(&buf, &len);
+
+  if (getenv("XDG_CACHE_HOME"))
+    fprintf(out, "%s/9cc", getenv("XDG_CACHE_HOME"));
+  else if (getenv("HOME"))
+    fprintf(out, "%s/.cache/9cc", getenv("HOME"));
+  else
+    fprintf(out, "/tmp/9cc-cache");
+
+  fclose(out);
+  return buf;
+}
+
+static char *format(char *fmt, ...) {
+  char *buf;
+  size_t len;
+  FILE *out = open_memstream(&buf, &len);
+
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(out, fmt, ap);
+  va_end(ap);
+  fclose(out);
+  return buf;
+}
+
+// Creates `path` and its parents, like `mkdir -p`.
+static bool mkdirs(char *path) {
+  char *p = strdup(path);
+  for (char *q = p + 1; *q; q++) {
+    if (*q != '/')
+      continue;
+    *q = '\0';
+    mkdir(p, 0755);
+    *q = '/';
+  }
+  mkdir(p, 0755);
+  free(p);
+
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static char *entry_path(void) {
+  return format("%s/%.2s/%s.s", opt_cache_dir, key, key + 2);
+}
+
+// Adds `hit` and `miss` to the counters in DIR/stats.
+static void update_stats(int hit, int miss) {
+  char *path = format("%s/stats", opt_cache_dir);
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  free(path);
+  if (fd < 0)
+    return;
+
+  struct flock lk = {.l_type = F_WRLCK, .l_whence = SEEK_SET};
+  if (fcntl(fd, F_SETLKW, &lk) < 0) {
+    close(fd);
+    return;
+  }
+
+  char buf[128] = {};
+  long hits = 0, misses = 0;
+  if (read(fd, buf, sizeof(buf) - 1) > 0)
+    sscanf(buf, "hits %ld misses %ld", &hits, &misses);
+
+  int len = snprintf(buf, sizeof(buf), "hits %ld misses %ld\n",
+                     hits + hit, misses + miss);
+  if (pwrite(fd, buf, len, 0) == len)
+    ftruncate(fd, len);
+  close(fd); // Also releases the lock.
+}
+
+// Copies the entry for `input` to `out` and returns true if it exists.
+bool cache_lookup(char *input, FILE *out) {
+  compute_key(input);
+  mkdirs(opt_cache_dir);
+
+  char *path = entry_path();
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    free(path);
+    update_stats(0, 1);
+    return false;
+  }
+
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    fwrite(buf, 1, n, out);
+  fclose(fp);
+
+  // Mark the entry as recently used for eviction.
+  utimensat(AT_FDCWD, path, NULL, 0);
+  free(path);
+  update_stats(1, 0);
+  return true;
+}
+
+// Returns true if `name` is `len` lowercase hex digits followed by
+// `suffix`. Nothing else in the cache directory is ever touched.
+static bool is_hex_name(char *name, int len, char *suffix) {
+  for (int i = 0; i < len; i++)
+    if (!isdigit(name[i]) && !('a' <= name[i] && name[i] <= 'f'))
+      return false;
+  return !strcmp(name + len, suffix);
+}
+
+// Returns true if `name` is a temporary file made by cache_store().
+static bool is_tmp_name(char *name) {
+  return !strncmp(name, ".tmp.", 5) && strlen(name) == 11;
+}
+
+typedef struct {
+  char *path;
+  long size;
+  time_t mtime;
+  bool tmp; // A temporary file, not an entry
+} Entry;
+
+// Lists all entries and temporary files in the cache. Both count toward
+// its size. Returns the number of files.
+static int list_entries(Entry **entries, long *total) {
+  int n = 0, cap = 64;
+  *entries = calloc(cap, sizeof(Entry));
+  *total = 0;
+
+  DIR *top = opendir(opt_cache_dir);
+  if (!top)
+    return 0;
+
+  for (struct dirent *d; (d = readdir(top));) {
+    if (!is_hex_name(d->d_name, 2, ""))
+      continue;
+
+    char *dir = format("%s/%s", opt_cache_dir, d->d_name);
+    DIR *sub = opendir(dir);
+    if (!sub) {
+      free(dir);
+      continue;
+    }
+
+    for (struct dirent *e; (e = readdir(sub));) {
+      bool tmp = is_tmp_name(e->d_name);
+      if (!tmp && !is_hex_name(e->d_name, 30, ".s"))
+        continue;
+
+      char *path = format("%s/%s", dir, e->d_name);
+      struct stat st;
+      if (lstat(path, &st) || !S_ISREG(st.st_mode)) {
+        free(path);
+        continue;
+      }
+
+      if (n == cap) {
+        cap *= 2;
+        *entries = realloc(*entries, cap * sizeof(Entry));
+      }
+      (*entries)[n++] = (Entry){path, st.st_size, st.st_mtime, tmp};
+      *total += st.st_size;
+    }
+
+    closedir(sub);
+    free(dir);
+  }
+
+  closedir(top);
+  return n;
+}
+
+static int cmp_mtime(const void *a, const void *b) {
+  time_t x = ((Entry *)a)->mtime, y = ((Entry *)b)->mtime;
+  return (x > y) - (x < y);
+}
+
+// Deletes stale temporary files, then least recently used entries
+// until the cache is at 90% of its size limit. Temporary files of
+// compiles that may still be running are left alone.
+static void evict(void) {
+  Entry *entries;
+  long total;
+  int n = list_entries(&entries, &total);
+  time_t now = time(NULL);
+
+  for (int i = 0; i < n; i++) {
+    Entry *e = &entries[i];
+    if (!e->tmp || now - e->mtime <= STALE_TMP_SECONDS)
+      continue;
+    if (unlink(e->path) == 0) {
+      total -= e->size;
+      e->size = 0;
+    }
+  }
+
+  if (total > opt_cache_max_size) {
+    qsort(entries, n, sizeof(Entry), cmp_mtime);
+    for (int i = 0; i < n && total > opt_cache_max_size / 10 * 9; i++)
+      if (!entries[i].tmp && unlink(entries[i].path) == 0)
+        total -= entries[i].size;
+  }
+
+  for (int i = 0; i < n; i++)
+    free(entries[i].path);
+  free(entries);
+}
+
+// Stores the assembly for the input last passed to cache_lookup().
+void cache_store(char *buf, size_t len) {
+  char *dir = format("%s/%.2s", opt_cache_dir, key);
+  if (!mkdirs(dir)) {
+    free(dir);
+    return;
+  }
+
+  char *tmp = format("%s/.tmp.XXXXXX", dir);
+  int fd = mkstemp(tmp);
+  free(dir);
+  if (fd < 0) {
+    free(tmp);
+    return;
+  }
+
+  // mkstemp creates the file 0600, which other users of a shared cache
+  // directory couldn't read.
+  bool ok = write(fd, buf, len) == len && !fchmod(fd, 0644);
+  ok = !close(fd) && ok;
+
+  char *path = entry_path();
+  if (!ok || rename(tmp, path))
+    unlink(tmp);
+  free(tmp);
+  free(path);
+
+  evict();
+}
+
+// Prints hit/miss counters and the cache size for --cache-stats.
+void cache_print_stats(void) {
+  long hits = 0, misses = 0;
+  char *path = format("%s/stats", opt_cache_dir);
+  FILE *fp = fopen(path, "r");
+  if (fp) {
+    if (fscanf(fp, "hits %ld misses %ld", &hits, &misses) != 2)
+      hits = misses = 0;
+    fclose(fp);
+  }
+  free(path);
+
+  Entry *entries;
+  long total;
+  int n = list_entries(&entries, &total);
+  int nr_entries = 0;
+  for (int i = 0; i < n; i++) {
+    nr_entries += !entries[i].tmp;
+    free(entries[i].path);
+  }
+  free(entries);
+
+  long lookups = hits + misses;
+  printf("cache directory  %s\n", opt_cache_dir);
+  printf("hits             %ld\n", hits);
+  printf("misses           %ld\n", misses);
+  printf("hit rate         %.1f%%\n", lookups ? hits * 100.0 / lookups : 0);
+  printf("entries          %d\n", nr_entries);
+  printf("size             %ld bytes\n", total);
+  printf("max size         %ld bytes\n", opt_cache_max_size);
+}
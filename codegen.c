@@ -2,9 +2,26 @@
 
 // レジスタのtop
 static int top;
+// Assembly is written here.
+static FILE *output_file;
 // 引数のレジスタ 6変数まで
 static char *argreg[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
 
+// Prints one line of assembly. Instructions are indented and labels end
+// with ':', which is how they are told apart for --stats.
+static void println(char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(output_file, fmt, ap);
+  va_end(ap);
+  fprintf(output_file, "\n");
+
+  if (fmt[0] == ' ' && fmt[2] != '.')
+    stats_insn();
+  else if (fmt[strlen(fmt) - 1] == ':')
+    stats_label();
+}
+
 // 数えてくれる
 static int count(void) {
   static int i = 1;
@@ -20,54 +37,445 @@ static char *reg(int idx) {
 }
 
 static void gen_expr(Node *node);
+static void gen_stmt(Node *node);
 
-// lea dst, [src] : [src]のアドレス計算を行うが、メモリアクセスは行わずアドレス計算の結果そのものをdstにストア
-// Pushes the given node's address to the stack.
-static void gen_addr(Node *node) {
-  switch (node->kind) {
-  case ND_VAR:
-    printf("  lea -%d(%%rbp), %s\n", node->var->offset, reg(top++));
+//
+// Profile-guided optimization
+//
+// --profile-generate numbers every "if" and "for" in AST order. Each
+// "if" gets a counter for its then-arm and one for its else-arm, and
+// each "for" gets one for loop entry and one for the body. Counter 0
+// counts function entries. The program dumps the counters on return
+// from main as a 3-word header (magic, layout hash, number of counters)
+// followed by the counters.
+//
+// --profile-use reads that file back. Because counters are numbered on
+// the AST, emission order can change freely in use mode.
+//
+
+#define PROFILE_MAGIC 0x31666f7270633939 // "99cprof1"
+
+// A loop whose body ran this many times is hot.
+#define HOT_LOOP 1000
+
+char *opt_profile_generate;
+char *opt_profile_use;
+
+static int nr_counters;
+static unsigned long layout_hash;
+static long *profile;
+
+// Blocks deferred to the end of the function because they never ran.
+typedef struct ColdBlock ColdBlock;
+struct ColdBlock {
+  ColdBlock *next;
+  Node *stmt;
+  int counter;
+  char *label;
+  int c;
+};
+
+static ColdBlock *cold_blocks;
+
+// Assigns counters to "if" and "for" statements in AST order and hashes
+// the layout so a stale profile is detected.
+static void number_blocks(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_IF || node->kind == ND_FOR) {
+      node->prof_id = nr_counters;
+      nr_counters += 2;
+      layout_hash = (layout_hash ^ node->kind) * 0x100000001b3;
+      layout_hash = (layout_hash ^ node->tok->line_no) * 0x100000001b3;
+    }
+    number_blocks(node->init);
+    number_blocks(node->then);
+    number_blocks(node->els);
+    number_blocks(node->body);
+  }
+}
+
+static void load_profile(char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    error("%s: プロファイルを開けません", path);
+
+  unsigned long hdr[3];
+  if (fread(hdr, sizeof(long), 3, fp) != 3 || hdr[0] != PROFILE_MAGIC)
+    error("%s: プロファイルの形式が不正です", path);
+
+  if (hdr[1] != layout_hash || hdr[2] != nr_counters) {
+    fprintf(stderr, "%s: プロファイルがプログラムと一致しないため無視します\n",
+            path);
+    fclose(fp);
     return;
-  case ND_DEREF:
-    gen_expr(node->lhs);
+  }
+
+  profile = calloc(nr_counters, sizeof(long));
+  if (fread(profile, sizeof(long), nr_counters, fp) != nr_counters)
+    error("%s: プロファイルが途中で切れています", path);
+  fclose(fp);
+}
+
+// Returns the execution count of a block, or -1 without a profile.
+static long prof_count(int counter) {
+  return profile ? profile[counter] : -1;
+}
+
+// Emits a counter increment at the start of a block.
+static void gen_counter(int counter) {
+  if (opt_profile_generate)
+    println("  incq .L.prof.counters+%d(%%rip)", counter * 8);
+}
+
+static void gen_arm(Node *stmt, int counter) {
+  gen_counter(counter);
+  if (stmt)
+    gen_stmt(stmt);
+}
+
+static void add_cold_block(Node *stmt, int counter, char *label, int c) {
+  ColdBlock *cb = calloc(1, sizeof(ColdBlock));
+  cb->stmt = stmt;
+  cb->counter = counter;
+  cb->label = label;
+  cb->c = c;
+  cb->next = cold_blocks;
+  cold_blocks = cb;
+}
+
+// Emits deferred blocks. Each one jumps back to its join point.
+static void gen_cold_blocks(void) {
+  while (cold_blocks) {
+    ColdBlock *cb = cold_blocks;
+    cold_blocks = cb->next;
+    println(".L.%s.%d:", cb->label, cb->c);
+    gen_arm(cb->stmt, cb->counter);
+    println("  jmp .L.end.%d", cb->c);
+  }
+}
+
+static void count_node(Node *node, void *arg) {
+  (*(int *)arg)++;
+}
+
+static int count_nodes(Node *node) {
+  int n = 0;
+  visit_nodes(node, count_node, &n);
+  return n;
+}
+
+// How many copies of a loop body to emit per trip around the loop.
+// Small hot loops with a high average trip count are unrolled.
+static int unroll_factor(Node *node) {
+  long entries = prof_count(node->prof_id);
+  long trips = prof_count(node->prof_id + 1);
+  if (trips < HOT_LOOP || entries <= 0 || trips / entries < 8)
+    return 1;
+
+  int size = count_nodes(node->then) + count_nodes(node->cond) +
+             count_nodes(node->inc);
+  if (size <= 16)
+    return 4;
+  if (size <= 64)
+    return 2;
+  return 1;
+}
+
+// Writes the counters to the profile file with raw syscalls, so the
+// program needs nothing from libc. %rax holds main's return value.
+static void gen_profile_dump(void) {
+  println("  push %%rax");
+  println("  mov $2, %%eax"); // open
+  println("  lea .L.prof.path(%%rip), %%rdi");
+  println("  mov $0x241, %%esi"); // O_WRONLY | O_CREAT | O_TRUNC
+  println("  mov $0644, %%edx");
+  println("  syscall");
+  println("  test %%rax, %%rax");
+  println("  js  .L.prof.done");
+  println("  mov %%rax, %%r12");
+  println("  mov $1, %%eax"); // write
+  println("  mov %%r12, %%rdi");
+  println("  lea .L.prof(%%rip), %%rsi");
+  println("  mov $%d, %%edx", (3 + nr_counters) * 8);
+  println("  syscall");
+  println("  mov $3, %%eax"); // close
+  println("  mov %%r12, %%rdi");
+  println("  syscall");
+  println(".L.prof.done:");
+  println("  pop %%rax");
+}
+
+static void gen_profile_data(void) {
+  println("  .data");
+  println("  .align 8");
+  println(".L.prof:");
+  println("  .quad 0x%lx", PROFILE_MAGIC);
+  println("  .quad 0x%lx", layout_hash);
+  println("  .quad %d", nr_counters);
+  println(".L.prof.counters:");
+  println("  .zero %d", nr_counters * 8);
+  println(".L.prof.path:");
+  println("  .string \"%s\"", opt_profile_generate);
+}
+
+// Emits a .loc directive when the source line changes, so perf and gdb
+// can attribute instructions to lines.
+static void emit_loc(Node *node) {
+  static int line_no;
+  if (node->tok->line_no == line_no)
+    return;
+  line_no = node->tok->line_no;
+  println("  .loc 1 %d", line_no);
+}
+
+//
+// Instruction selection
+//
+// gen_expr covers the expression tree with x86-64 instruction patterns
+// (tiles) by maximal munch: at each node it takes the largest tile that
+// matches and falls back to one instruction per node. The table lists
+// the tiles and what they cost in instructions, next to the generic
+// sequence they replace. E is any expression computed into a register.
+//
+//   tile                       pattern                    cost  generic
+//   mov -off(%rbp), r          x                            1      2
+//   mov r, -off(%rbp)          x = E                        1+E    2+E
+//   op $imm, r                 E op n                       1+E    2+E
+//   op -off(%rbp), r           E op x                       1+E    3+E
+//   op disp(b,i,s), r          E op *(A)                    1+A    2+A
+//   mov disp(b,i,s), r         *(A)                         1+A    N
+//   lea disp(b,i,s), r         A, A uses %rbp or an index   1+A    N
+//   test r, r                  E == 0, E != 0, E < 0 ...    1+E    2+E
+//   cmp; jcc                   "if" and "for" on E cmp E    2+E    6+E
+//   neg r                      -E                           1+E    2+E
+//
+// where A is an address disp(base, index, scale) built from &x, E + n,
+// E - n and E + E*s for s in 1, 2, 4 and 8.
+//
+
+// Returns true if `node` is an integer literal that fits in the
+// sign-extended 32-bit immediate of an instruction.
+static bool is_imm(Node *node) {
+  return node->kind == ND_NUM && node->val == (int)node->val;
+}
+
+static bool is_num(Node *node, long val) {
+  return node->kind == ND_NUM && node->val == val;
+}
+
+// E*s where s is a valid scale of an index register.
+static bool is_scaled(Node *node) {
+  return node->kind == ND_MUL &&
+         (is_num(node->rhs, 1) || is_num(node->rhs, 2) ||
+          is_num(node->rhs, 4) || is_num(node->rhs, 8));
+}
+
+// A memory operand disp(base, index, scale). The base is %rbp if `rbp`
+// is set and `base` computed into a register otherwise.
+typedef struct {
+  bool rbp;
+  Node *base;
+  Node *index;
+  int scale;
+  long disp;
+} Addr;
+
+// Matches the address expression `node` against disp(base, index,
+// scale). Anything that doesn't match becomes the base register. Base
+// and index are always in source order, so side effects stay ordered.
+static void match_addr(Node *node, Addr *a) {
+  switch (node->kind) {
+  case ND_ADDR:
+    if (node->lhs->kind == ND_VAR) {
+      *a = (Addr){.rbp = true, .scale = 1, .disp = -node->lhs->var->offset};
+      return;
+    }
+    break;
+  case ND_ADD:
+  case ND_SUB: {
+    Addr b;
+    if (is_imm(node->rhs)) {
+      match_addr(node->lhs, &b);
+      long disp = b.disp + (node->kind == ND_ADD ? node->rhs->val : -node->rhs->val);
+      if (disp == (int)disp) {
+        *a = b;
+        a->disp = disp;
+        return;
+      }
+    }
+    if (node->kind == ND_ADD && is_scaled(node->rhs)) {
+      match_addr(node->lhs, &b);
+      if (!b.index) {
+        *a = b;
+        a->index = node->rhs->lhs;
+        a->scale = node->rhs->rhs->val;
+        return;
+      }
+    }
+    break;
+  }
+  }
+
+  *a = (Addr){.base = node, .scale = 1};
+}
+
+// Computes the base and index of `a` into registers and writes the
+// operand to `buf`. Returns the number of registers it used.
+static int gen_mem(Addr *a, char *buf) {
+  int n = 0;
+  char *base = "%rbp";
+  if (!a->rbp) {
+    gen_expr(a->base);
+    base = reg(top - 1);
+    n++;
+  }
+
+  if (!a->index) {
+    sprintf(buf, "%ld(%s)", a->disp, base);
+    return n;
+  }
+
+  gen_expr(a->index);
+  n++;
+  sprintf(buf, "%ld(%s,%s,%d)", a->disp, base, reg(top - 1), a->scale);
+  return n;
+}
+
+// Makes `node` a source operand in `buf`: an immediate, a memory
+// reference or, failing that, a register. Returns the number of
+// registers it used.
+static int gen_operand(Node *node, char *buf) {
+  if (is_imm(node)) {
+    sprintf(buf, "$%ld", node->val);
+    return 0;
+  }
+
+  if (node->kind == ND_VAR) {
+    sprintf(buf, "-%d(%%rbp)", node->var->offset);
+    return 0;
+  }
+
+  if (node->kind == ND_DEREF) {
+    Addr a;
+    match_addr(node->lhs, &a);
+    return gen_mem(&a, buf);
+  }
+
+  gen_expr(node);
+  strcpy(buf, reg(top - 1));
+  return 1;
+}
+
+// Frees the `n` registers an operand used and returns the register that
+// receives the result: the lowest of them, or a new one if n is 0.
+static char *result_reg(int n) {
+  if (n == 0)
+    return reg(top++);
+  top -= n - 1;
+  return reg(top - 1);
+}
+
+// Compares the operands of the comparison `node`, leaving the result in
+// the flags. `E cmp 0` uses test.
+static void gen_cmp(Node *node) {
+  gen_expr(node->lhs);
+  char *rd = reg(top - 1);
+
+  if (is_num(node->rhs, 0)) {
+    println("  test %s, %s", rd, rd);
     return;
   }
 
-  error("not an lvalue");
+  char rs[64];
+  int n = gen_operand(node->rhs, rs);
+  println("  cmp %s, %s", rs, rd);
+  top -= n;
 }
 
-static void load(void) {
-  printf("  mov (%s), %s\n", reg(top - 1), reg(top - 1));
+// Returns the condition code that holds after gen_cmp(node), or its
+// inverse if `negate` is set.
+static char *cond_code(NodeKind kind, bool negate) {
+  switch (kind) {
+  case ND_EQ: return negate ? "ne" : "e";
+  case ND_NE: return negate ? "e" : "ne";
+  case ND_LT: return negate ? "ge" : "l";
+  case ND_LE: return negate ? "g" : "le";
+  }
+  error("invalid comparison");
+  return NULL;
 }
 
-static void store(void) {
-  printf("  mov %s, (%s)\n", reg(top - 2), reg(top - 1));
-  top--;
+static bool is_cmp(Node *node) {
+  return node->kind == ND_EQ || node->kind == ND_NE ||
+         node->kind == ND_LT || node->kind == ND_LE;
+}
+
+// Jumps to .L.<label>.<c> if `cond` is `when`. A comparison branches on
+// its own flags instead of materializing 0 or 1 first.
+static void gen_branch(Node *cond, bool when, char *label, int c) {
+  if (is_cmp(cond)) {
+    gen_cmp(cond);
+    top--;
+    println("  j%s .L.%s.%d", cond_code(cond->kind, !when), label, c);
+    return;
+  }
+
+  gen_expr(cond);
+  char *r = reg(--top);
+  println("  test %s, %s", r, r);
+  println("  j%s .L.%s.%d", when ? "ne" : "e", label, c);
 }
 
 // Nodeから実行コードを出力する
 // Generate code for a given node.
 static void gen_expr(Node *node) {
+  emit_loc(node);
+
+  char buf[64];
+
   switch (node->kind) {
   case ND_NUM:
-    printf("  mov $%lu, %s\n", node->val, reg(top++));
+    println("  mov $%ld, %s", node->val, reg(top++));
     return;
   case ND_VAR:
-    gen_addr(node);
-    load();
+    println("  mov -%d(%%rbp), %s", node->var->offset, reg(top++));
     return;
-  case ND_DEREF:
-    gen_expr(node->lhs);
-    load();
+  case ND_DEREF: {
+    Addr a;
+    match_addr(node->lhs, &a);
+    int n = gen_mem(&a, buf);
+    println("  mov %s, %s", buf, result_reg(n));
     return;
+  }
   case ND_ADDR:
-    gen_addr(node->lhs);
-    return;
-  case ND_ASSIGN:
+    // lea dst, [src] : [src]のアドレス計算を行うが、メモリアクセスは行わずアドレス計算の結果そのものをdstにストア
+    if (node->lhs->kind == ND_VAR) {
+      println("  lea -%d(%%rbp), %s", node->lhs->var->offset, reg(top++));
+      return;
+    }
+    if (node->lhs->kind == ND_DEREF) {
+      gen_expr(node->lhs->lhs);
+      return;
+    }
+    error("not an lvalue");
+  case ND_ASSIGN: {
     gen_expr(node->rhs);
-    gen_addr(node->lhs);
-    store();
-    return;
+    char *rs = reg(top - 1);
+
+    if (node->lhs->kind == ND_VAR) {
+      println("  mov %s, -%d(%%rbp)", rs, node->lhs->var->offset);
+      return;
+    }
+    if (node->lhs->kind == ND_DEREF) {
+      Addr a;
+      match_addr(node->lhs->lhs, &a);
+      int n = gen_mem(&a, buf);
+      println("  mov %s, %s", rs, buf);
+      top -= n;
+      return;
+    }
+    error("not an lvalue");
+  }
   case ND_FUNCALL: {
     int nargs = 0;
     for (Node *arg = node->args; arg; arg = arg->next) {
@@ -76,65 +484,84 @@ static void gen_expr(Node *node) {
     }
     // 引数
     for (int i = 1; i <= nargs; i++)
-      printf("  mov %s, %s\n", reg(--top), argreg[nargs - i]);
-    printf("  push %%r10\n");
-    printf("  push %%r11\n");
-    printf("  mov $0, %%rax\n");
-    printf("  call %s\n", node->funcname);
-    printf("  pop %%r11\n");
-    printf("  pop %%r10\n");
-    printf("  mov %%rax, %s\n", reg(top++));
+      println("  mov %s, %s", reg(--top), argreg[nargs - i]);
+    println("  push %%r10");
+    println("  push %%r11");
+    println("  mov $0, %%rax");
+    println("  call %s", node->funcname);
+    println("  pop %%r11");
+    println("  pop %%r10");
+    println("  mov %%rax, %s", reg(top++));
+    return;
+  }
+  case ND_ADD:
+  case ND_SUB: {
+    if (node->kind == ND_SUB && is_num(node->lhs, 0)) {
+      gen_expr(node->rhs);
+      println("  neg %s", reg(top - 1));
+      return;
+    }
+
+    // An address with %rbp or an index register is a single lea.
+    Addr a;
+    match_addr(node, &a);
+    if (a.rbp || a.index) {
+      int n = gen_mem(&a, buf);
+      println("  lea %s, %s", buf, result_reg(n));
+      return;
+    }
+    break;
+  }
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE: {
+    gen_cmp(node);
+    char *rd = reg(top - 1);
+    // フラグレジスタは通常の整数レジスタではないので、RAXに比較結果をセットしたい場合、フラグレジスタの特定のビットをRAXにコピーしてくる必要があります。
+    //それを行うのがsete命令です。sete命令は、直前のcmp命令で調べた2つのレジスタの値が同じだった場合に、指定されたレジスタ（ここではAL）に1をセットします。それ以外の場合は0をセットします。
+
+    // ALというのは本書のここまでに登場していない新しいレジスタ名ですが、実はALはRAXの下位8ビットを指す別名レジスタにすぎません。従ってseteがALに値をセットすると、自動的にRAXも更新されることになります。
+    println("  set%s %%al", cond_code(node->kind, false));
+    // ただし、RAXをAL経由で更新するときに上位56ビットは元の値のままになるので、RAX全体を0か1にセットしたい場合、上位56ビットはゼロクリアする必要があります。それを行うのがmovzb命令です。sete命令が直接RAXに書き込めればよいのですが、seteは8ビットレジスタしか引数に取れない仕様になっているので、比較命令では、このように2つの命令を使ってRAXに値をセットすることになります。
+    println("  movzx %%al, %s", rd);
     return;
   }
   }
 
   gen_expr(node->lhs);
-  gen_expr(node->rhs);
 
-  char *rd = reg(top - 2);
-  char *rs = reg(top - 1);
-  top--;
+  // idiv has no immediate form.
+  int n;
+  if (node->kind == ND_DIV && is_imm(node->rhs)) {
+    gen_expr(node->rhs);
+    strcpy(buf, reg(top - 1));
+    n = 1;
+  } else {
+    n = gen_operand(node->rhs, buf);
+  }
+
+  char *rd = reg(top - 1 - n);
+  top -= n;
 
   switch (node->kind) {
   case ND_ADD:
-    printf("  add %s, %s\n", rs, rd);
+    println("  add %s, %s", buf, rd);
     return;
   case ND_SUB:
-    printf("  sub %s, %s\n", rs, rd);
+    println("  sub %s, %s", buf, rd);
     return;
   case ND_MUL:
-    printf("  imul %s, %s\n", rs, rd);
+    if (is_imm(node->rhs))
+      println("  imul %s, %s, %s", buf, rd, rd);
+    else
+      println("  imul %s, %s", buf, rd);
     return;
   case ND_DIV:
-    printf("  mov %s, %%rax\n", rd);
-    printf("  cqo\n");
-    printf("  idiv %s\n", rs);
-    printf("  mov %%rax, %s\n", rd);
-    return;
-  case ND_EQ:
-    printf("  cmp %s, %s\n", rs, rd);
-    // フラグレジスタは通常の整数レジスタではないので、RAXに比較結果をセットしたい場合、フラグレジスタの特定のビットをRAXにコピーしてくる必要があります。
-    //それを行うのがsete命令です。sete命令は、直前のcmp命令で調べた2つのレジスタの値が同じだった場合に、指定されたレジスタ（ここではAL）に1をセットします。それ以外の場合は0をセットします。
-
-    // ALというのは本書のここまでに登場していない新しいレジスタ名ですが、実はALはRAXの下位8ビットを指す別名レジスタにすぎません。従ってseteがALに値をセットすると、自動的にRAXも更新されることになります。
-    printf("  sete %%al\n");
-    // ただし、RAXをAL経由で更新するときに上位56ビットは元の値のままになるので、RAX全体を0か1にセットしたい場合、上位56ビットはゼロクリアする必要があります。それを行うのがmovzb命令です。sete命令が直接RAXに書き込めればよいのですが、seteは8ビットレジスタしか引数に取れない仕様になっているので、比較命令では、このように2つの命令を使ってRAXに値をセットすることになります。
-    printf("  movzx %%al, %s\n", rd);
-    return;
-  case ND_NE:
-    printf("  cmp %s, %s\n", rs, rd);
-    printf("  setne %%al\n");
-    printf("  movzx %%al, %s\n", rd);
-    return;
-  case ND_LT:
-    printf("  cmp %s, %s\n", rs, rd);
-    printf("  setl %%al\n");
-    printf("  movzx %%al, %s\n", rd);
-    return;
-  case ND_LE:
-    printf("  cmp %s, %s\n", rs, rd);
-    printf("  setle %%al\n");
-    printf("  movzx %%al, %s\n", rd);
+    println("  mov %s, %%rax", rd);
+    println("  cqo");
+    println("  idivq %s", buf);
+    println("  mov %%rax, %s", rd);
     return;
   default:
     error("invalid expression");
@@ -142,37 +569,75 @@ static void gen_expr(Node *node) {
 }
 
 static void gen_stmt(Node *node) {
+  emit_loc(node);
+
   switch (node->kind) {
   case ND_IF: {
     int c = count();
-    gen_expr(node->cond);
-    printf("  cmp $0, %s\n", reg(--top));
-    printf("  je  .L.else.%d\n", c);
-    gen_stmt(node->then);
-    printf("  jmp .L.end.%d\n", c);
-    printf(".L.else.%d:\n", c);
-    if (node->els)
-      gen_stmt(node->els);
-    printf(".L.end.%d:\n", c);
+    int then_id = node->prof_id, els_id = node->prof_id + 1;
+    long then_cnt = prof_count(then_id);
+    long els_cnt = prof_count(els_id);
+
+    // The then-arm never ran: move it out of line.
+    if (then_cnt == 0 && els_cnt > 0) {
+      gen_branch(node->cond, true, "then", c);
+      gen_arm(node->els, els_id);
+      println(".L.end.%d:", c);
+      add_cold_block(node->then, then_id, "then", c);
+      return;
+    }
+
+    // The else-arm never ran: move it out of line.
+    if (els_cnt == 0 && then_cnt > 0 && node->els) {
+      gen_branch(node->cond, false, "else", c);
+      gen_arm(node->then, then_id);
+      println(".L.end.%d:", c);
+      add_cold_block(node->els, els_id, "else", c);
+      return;
+    }
+
+    // The else-arm is hotter: let it fall through.
+    if (els_cnt > then_cnt) {
+      gen_branch(node->cond, true, "then", c);
+      gen_arm(node->els, els_id);
+      println("  jmp .L.end.%d", c);
+      println(".L.then.%d:", c);
+      gen_arm(node->then, then_id);
+      println(".L.end.%d:", c);
+      return;
+    }
+
+    gen_branch(node->cond, false, "else", c);
+    gen_arm(node->then, then_id);
+    println("  jmp .L.end.%d", c);
+    println(".L.else.%d:", c);
+    gen_arm(node->els, els_id);
+    println(".L.end.%d:", c);
     return;
   }
   case ND_FOR: {
     int c = count();
     if (node->init)
       gen_stmt(node->init);
-    printf(".L.begin.%d:\n", c);
-    if (node->cond) {
-      gen_expr(node->cond);
-      printf("  cmp $0, %s\n", reg(--top));
-      printf("  je  .L.end.%d\n", c);
-    }
-    gen_stmt(node->then);
-    if (node->inc) {
-      gen_expr(node->inc);
-      top--;
+    gen_counter(node->prof_id);
+
+    if (prof_count(node->prof_id + 1) >= HOT_LOOP)
+      println("  .p2align 4");
+    println(".L.begin.%d:", c);
+
+    // An unrolled loop repeats the whole iteration, exit test included.
+    int unroll = unroll_factor(node);
+    for (int i = 0; i < unroll; i++) {
+      if (node->cond)
+        gen_branch(node->cond, false, "end", c);
+      gen_arm(node->then, node->prof_id + 1);
+      if (node->inc) {
+        gen_expr(node->inc);
+        top--;
+      }
     }
-    printf("  jmp .L.begin.%d\n", c);
-    printf(".L.end.%d:\n", c);
+    println("  jmp .L.begin.%d", c);
+    println(".L.end.%d:", c);
     return;
   }
   case ND_BLOCK:
@@ -181,8 +646,8 @@ static void gen_stmt(Node *node) {
     return;
   case ND_RETURN:
     gen_expr(node->lhs);
-    printf("  mov %s, %%rax\n", reg(--top));
-    printf("  jmp .L.return\n");
+    println("  mov %s, %%rax", reg(--top));
+    println("  jmp .L.return");
     return;
   case ND_EXPR_STMT:
     gen_expr(node->lhs);
@@ -193,29 +658,48 @@ static void gen_stmt(Node *node) {
   }
 }
 
-void codegen(Function *prog) {
-  printf(".globl main\n");
-  printf("main:\n");
+void codegen(Function *prog, FILE *out) {
+  output_file = out;
+
+  // Counter 0 counts calls to main.
+  nr_counters = 1;
+  layout_hash = 0xcbf29ce484222325;
+  number_blocks(prog->body);
+  if (opt_profile_use)
+    load_profile(opt_profile_use);
+
+  println(".file 1 \"%s\"", input_path);
+  println(".globl main");
+  println(".type main, @function");
+  println("main:");
 
   // Prologue. %r12-15 are callee-saved registers.
-  printf("  push %%rbp\n");
-  printf("  mov %%rsp, %%rbp\n");
-  printf("  sub $%d, %%rsp\n", prog->stack_size);
-  printf("  mov %%r12, -8(%%rbp)\n");
-  printf("  mov %%r13, -16(%%rbp)\n");
-  printf("  mov %%r14, -24(%%rbp)\n");
-  printf("  mov %%r15, -32(%%rbp)\n");
+  println("  push %%rbp");
+  println("  mov %%rsp, %%rbp");
+  println("  sub $%d, %%rsp", prog->stack_size);
+  println("  mov %%r12, -8(%%rbp)");
+  println("  mov %%r13, -16(%%rbp)");
+  println("  mov %%r14, -24(%%rbp)");
+  println("  mov %%r15, -32(%%rbp)");
+  gen_counter(0);
 
   gen_stmt(prog->body);
   assert(top == 0);
 
   // Epilogue
-  printf(".L.return:\n");
-  printf("  mov -8(%%rbp), %%r12\n");
-  printf("  mov -16(%%rbp), %%r13\n");
-  printf("  mov -24(%%rbp), %%r14\n");
-  printf("  mov -32(%%rbp), %%r15\n");
-  printf("  mov %%rbp, %%rsp\n");
-  printf("  pop %%rbp\n");
-  printf("  ret\n");
+  println(".L.return:");
+  if (opt_profile_generate)
+    gen_profile_dump();
+  println("  mov -8(%%rbp), %%r12");
+  println("  mov -16(%%rbp), %%r13");
+  println("  mov -24(%%rbp), %%r14");
+  println("  mov -32(%%rbp), %%r15");
+  println("  mov %%rbp, %%rsp");
+  println("  pop %%rbp");
+  println("  ret");
+  gen_cold_blocks();
+  println(".size main, .-main");
+
+  if (opt_profile_generate)
+    gen_profile_data();
 }
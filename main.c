@@ -1,18 +1,168 @@
 #include "9cc.h"
+#include <errno.h>
+#include <limits.h>
 
 // よくわからない
 static int align_to(int n, int align) {
   return (n + align - 1) / align * align;
 }
 
+// Source file name for debug info.
+char *input_path = "<command-line>";
+
+static char *input;
+static bool opt_cache_stats;
+
+static void usage(void) {
+  error("使い方: 9cc [--stats[=json] | -ftime-report] "
+        "[--lex=auto|scalar|sse2|avx2] [--cache | --cache-dir=DIR] "
+        "[--cache-max-size=N[K|M|G]]\n"
+        "           [--profile-generate[=FILE] | --profile-use=FILE] "
+        "<program | ->\n"
+        "       9cc [--cache-dir=DIR] --cache-stats");
+}
+
+// Parses a size such as "512K" or "64M". A size must be positive: with
+// a limit of 0 every store would evict the whole cache.
+static long parse_size(char *s) {
+  char *end;
+  errno = 0;
+  long val = strtol(s, &end, 10);
+
+  int shift = 0;
+  if (end != s) {
+    switch (*end) {
+    case 'K': shift = 10; end++; break;
+    case 'M': shift = 20; end++; break;
+    case 'G': shift = 30; end++; break;
+    }
+  }
+
+  if (end == s || *end || errno || val <= 0 || val > LONG_MAX >> shift)
+    error("不正なサイズです: %s", s);
+  return val << shift;
+}
+
+// Reads the whole program from stdin. Generated benchmark programs are
+// far larger than what fits in a single argv string.
+static char *read_stdin(void) {
+  char *buf;
+  size_t buflen;
+  FILE *out = open_memstream(&buf, &buflen);
+
+  for (;;) {
+    char buf2[4096];
+    int n = fread(buf2, 1, sizeof(buf2), stdin);
+    if (n == 0)
+      break;
+    fwrite(buf2, 1, n, out);
+  }
+
+  fclose(out);
+  return buf;
+}
+
+static void parse_args(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "-ftime-report")) {
+      opt_stats = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--stats=json")) {
+      opt_stats = true;
+      opt_stats_json = true;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--lex=", 6)) {
+      opt_lex = argv[i] + 6;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--profile-generate")) {
+      opt_profile_generate = "9cc.prof";
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--profile-generate=", 19)) {
+      opt_profile_generate = argv[i] + 19;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--profile-use=", 14)) {
+      opt_profile_use = argv[i] + 14;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--cache")) {
+      if (!opt_cache_dir)
+        opt_cache_dir = cache_default_dir();
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--cache-dir=", 12)) {
+      opt_cache_dir = argv[i] + 12;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "--cache-max-size=", 17)) {
+      opt_cache_max_size = parse_size(argv[i] + 17);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--cache-stats")) {
+      opt_cache_stats = true;
+      continue;
+    }
+
+    if (input)
+      usage();
+    input = argv[i];
+  }
+
+  if (opt_cache_stats) {
+    if (!opt_cache_dir)
+      opt_cache_dir = cache_default_dir();
+    return;
+  }
+
+  if (!input)
+    usage();
+
+  if (!strcmp(input, "-")) {
+    input = read_stdin();
+    input_path = "<stdin>";
+  }
+}
+
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    error("引数の個数が正しくありません");
+  parse_args(argc, argv);
+
+  if (opt_cache_stats) {
+    cache_print_stats();
+    return 0;
+  }
+
+  // On a cache hit there is nothing left to do.
+  if (opt_cache_dir && cache_lookup(input, stdout)) {
+    if (opt_stats) {
+      fflush(stdout);
+      stats_report(input, NULL, NULL);
+    }
+    return 0;
   }
-  Token *tok = tokenize(argv[1]);
+
+  stats_begin(PH_TOKENIZE);
+  Token *tok = tokenize(input);
+  stats_end(PH_TOKENIZE);
+
+  stats_begin(PH_PARSE);
   Function *prog = parse(tok);
+  stats_end(PH_PARSE);
 
   // Assign offsets to local variables.
+  stats_begin(PH_OFFSETS);
   int offset = 32; // 32 for callee-saved registers
   for (Var *var = prog->locals; var; var = var->next) {
     offset += 8;
@@ -21,9 +171,29 @@ int main(int argc, char **argv) {
 
   // よくわからないけどヨシ！
   prog->stack_size = align_to(offset, 16);
+  stats_end(PH_OFFSETS);
 
   // Traverse the AST to emit assembly.
-  codegen(prog);
+  // With the cache enabled, the output is kept in memory so that it can
+  // be stored after it is written.
+  char *buf;
+  size_t buflen;
+  FILE *out = opt_cache_dir ? open_memstream(&buf, &buflen) : stdout;
+
+  stats_begin(PH_CODEGEN);
+  codegen(prog, out);
+  stats_end(PH_CODEGEN);
+
+  if (out != stdout) {
+    fclose(out);
+    fwrite(buf, 1, buflen, stdout);
+    cache_store(buf, buflen);
+  }
+
+  if (opt_stats) {
+    fflush(stdout);
+    stats_report(input, tok, prog);
+  }
 
   return 0;
 }
@@ -24,14 +24,15 @@ static Var *find_var(Token *tok) {
   return NULL;
 }
 
-static Node *new_node(NodeKind kind) {
+static Node *new_node(NodeKind kind, Token *tok) {
   Node *node = calloc(1, sizeof(Node));
   node->kind = kind;
+  node->tok = tok;
   return node;
 }
 
-static Node *new_var_node(Var *var) {
-  Node *node = new_node(ND_VAR);
+static Node *new_var_node(Var *var, Token *tok) {
+  Node *node = new_node(ND_VAR, tok);
   node->var = var;
   return node;
 }
@@ -44,22 +45,22 @@ static Var *new_lvar(char *name) {
   return var;
 }
 
-static Node *new_binary(NodeKind kind, Node *lhs, Node *rhs) {
-  Node *node = new_node(kind);
+static Node *new_binary(NodeKind kind, Node *lhs, Node *rhs, Token *tok) {
+  Node *node = new_node(kind, tok);
   node->lhs = lhs;
   node->rhs = rhs;
   return node;
 }
 
-static Node *new_unary(NodeKind kind, Node *expr) {
-  Node *node = new_node(kind);
+static Node *new_unary(NodeKind kind, Node *expr, Token *tok) {
+  Node *node = new_node(kind, tok);
   node->lhs = expr;
   return node;
 }
 
 
-static Node *new_num(long val) {
-  Node *node = new_node(ND_NUM);
+static Node *new_num(long val, Token *tok) {
+  Node *node = new_node(ND_NUM, tok);
   node->val = val;
   return node;
 }
@@ -73,12 +74,13 @@ static Node *new_num(long val) {
 static Node *stmt(Token **rest, Token *tok) {
   Node *node;
   if(equal(tok, "return")) {
-    node = new_unary(ND_RETURN, expr(&tok, tok->next));
+    node = new_node(ND_RETURN, tok);
+    node->lhs = expr(&tok, tok->next);
     *rest = skip(tok, ";");
     return node;
   }
   if (equal(tok, "if")) {
-    Node *node = new_node(ND_IF);
+    Node *node = new_node(ND_IF, tok);
     tok = skip(tok->next, "(");
     node->cond = expr(&tok, tok);
     tok = skip(tok, ")");
@@ -89,7 +91,7 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
    if (equal(tok, "for")) {
-    Node *node = new_node(ND_FOR);
+    Node *node = new_node(ND_FOR, tok);
     tok = skip(tok->next, "(");
 
     node->init = expr_stmt(&tok, tok);
@@ -106,7 +108,7 @@ static Node *stmt(Token **rest, Token *tok) {
     return node;
   }
    if (equal(tok, "while")) {
-     Node *node = new_node(ND_FOR);
+     Node *node = new_node(ND_FOR, tok);
      tok = skip(tok->next, "(");
      node->cond = expr(&tok, tok);
      tok = skip(tok, ")");
@@ -122,11 +124,11 @@ static Node *stmt(Token **rest, Token *tok) {
 // compound-stmt = stmt* "}"
 // あってもなくてもいいカッコ句
 static Node *compound_stmt(Token **rest, Token *tok) {
+  Node *node = new_node(ND_BLOCK, tok);
   Node head = {};
   Node *cur = &head;
   while (!equal(tok, "}"))
     cur = cur->next = stmt(&tok, tok);
-  Node *node = new_node(ND_BLOCK);
   node->body = head.next;
   *rest = tok->next;
   return node;
@@ -135,11 +137,12 @@ static Node *compound_stmt(Token **rest, Token *tok) {
 // expr-stmt = expr? ";"
 static Node *expr_stmt(Token **rest, Token *tok) {
   if (equal(tok, ";")) {
-    Node *node = new_node(ND_BLOCK);
+    Node *node = new_node(ND_BLOCK, tok);
     *rest = tok->next;
     return node;
   }
-  Node *node = new_unary(ND_EXPR_STMT, expr(&tok, tok));
+  Node *node = new_node(ND_EXPR_STMT, tok);
+  node->lhs = expr(&tok, tok);
   *rest = skip(tok, ";");
   return node;
 }
@@ -153,8 +156,10 @@ static Node *expr(Token **rest, Token *tok) {
 // = 代入をparseする。
 static Node *assign(Token **rest, Token *tok) {
   Node *node = equality(&tok, tok);
-  if (equal(tok, "="))
-    node = new_binary(ND_ASSIGN, node, assign(&tok, tok->next));
+  if (equal(tok, "=")) {
+    Token *start = tok;
+    node = new_binary(ND_ASSIGN, node, assign(&tok, tok->next), start);
+  }
   *rest = tok;
   return node;
 }
@@ -164,15 +169,17 @@ static Node *equality(Token **rest, Token *tok) {
   Node *node = relational(&tok, tok);
 
   for (;;) {
+    Token *start = tok;
+
     if (equal(tok, "==")) {
       Node *rhs = relational(&tok, tok->next);
-      node = new_binary(ND_EQ, node, rhs);
+      node = new_binary(ND_EQ, node, rhs, start);
       continue;
     }
 
     if (equal(tok, "!=")) {
       Node *rhs = relational(&tok, tok->next);
-      node = new_binary(ND_NE, node, rhs);
+      node = new_binary(ND_NE, node, rhs, start);
       continue;
     }
 
@@ -186,27 +193,29 @@ static Node *relational(Token **rest, Token *tok) {
   Node *node = add(&tok, tok);
 
   for (;;) {
+    Token *start = tok;
+
     if (equal(tok, "<")) {
       Node *rhs = add(&tok, tok->next);
-      node = new_binary(ND_LT, node, rhs);
+      node = new_binary(ND_LT, node, rhs, start);
       continue;
     }
 
     if (equal(tok, "<=")) {
       Node *rhs = add(&tok, tok->next);
-      node = new_binary(ND_LE, node, rhs);
+      node = new_binary(ND_LE, node, rhs, start);
       continue;
     }
 
     if (equal(tok, ">")) {
       Node *rhs = add(&tok, tok->next);
-      node = new_binary(ND_LT, rhs, node);
+      node = new_binary(ND_LT, rhs, node, start);
       continue;
     }
 
     if (equal(tok, ">=")) {
       Node *rhs = add(&tok, tok->next);
-      node = new_binary(ND_LE, rhs, node);
+      node = new_binary(ND_LE, rhs, node, start);
       continue;
     }
 
@@ -220,15 +229,17 @@ static Node *add(Token **rest, Token *tok) {
   Node *node = mul(&tok, tok);
 
   for (;;) {
+    Token *start = tok;
+
     if (equal(tok, "+")) {
       Node *rhs = mul(&tok, tok->next);
-      node = new_binary(ND_ADD, node, rhs);
+      node = new_binary(ND_ADD, node, rhs, start);
       continue;
     }
 
     if (equal(tok, "-")) {
       Node *rhs = mul(&tok, tok->next);
-      node = new_binary(ND_SUB, node, rhs);
+      node = new_binary(ND_SUB, node, rhs, start);
       continue;
     }
 
@@ -242,15 +253,17 @@ static Node *mul(Token **rest, Token *tok) {
   Node *node = unary(&tok, tok);
 
   for (;;) {
+    Token *start = tok;
+
     if (equal(tok, "*")) {
       Node *rhs = unary(&tok, tok->next);
-      node = new_binary(ND_MUL, node, rhs);
+      node = new_binary(ND_MUL, node, rhs, start);
       continue;
     }
 
     if (equal(tok, "/")) {
       Node *rhs = unary(&tok, tok->next);
-      node = new_binary(ND_DIV, node, rhs);
+      node = new_binary(ND_DIV, node, rhs, start);
       continue;
     }
 
@@ -266,13 +279,13 @@ static Node *unary(Token **rest, Token *tok) {
     return unary(rest, tok->next);
 
   if (equal(tok, "-"))
-    return new_binary(ND_SUB, new_num(0), unary(rest, tok->next));
+    return new_binary(ND_SUB, new_num(0, tok), unary(rest, tok->next), tok);
 
   if (equal(tok, "&"))
-    return new_unary(ND_ADDR, unary(rest, tok->next));
+    return new_unary(ND_ADDR, unary(rest, tok->next), tok);
 
   if (equal(tok, "*"))
-    return new_unary(ND_DEREF, unary(rest, tok->next));
+    return new_unary(ND_DEREF, unary(rest, tok->next), tok);
 
   return primary(rest, tok);
 }
@@ -293,7 +306,7 @@ static Node *funcall(Token **rest, Token *tok) {
 
   *rest = skip(tok, ")");
 
-  Node *node = new_node(ND_FUNCALL);
+  Node *node = new_node(ND_FUNCALL, start);
   node->funcname = strndup(start->loc, start->len);
   node->args = head.next;
   return node;
@@ -318,10 +331,10 @@ static Node *primary(Token **rest, Token *tok) {
       var = new_lvar(strndup(tok->loc, tok->len));
     }
     *rest = tok->next;
-    return new_var_node(var);
+    return new_var_node(var, tok);
   }
 
-  Node *node = new_num(get_number(tok));
+  Node *node = new_num(get_number(tok), tok);
   *rest = tok->next;
   return node;
 }
@@ -335,3 +348,21 @@ Function *parse(Token *tok) {
   prog->locals = locals;
   return prog;
 }
+
+// Calls `fn` on every node reachable from `node`, including its
+// siblings, parents before children. This is the one place that knows
+// which fields of Node hold children.
+void visit_nodes(Node *node, void (*fn)(Node *node, void *arg), void *arg) {
+  for (; node; node = node->next) {
+    fn(node, arg);
+    visit_nodes(node->lhs, fn, arg);
+    visit_nodes(node->rhs, fn, arg);
+    visit_nodes(node->cond, fn, arg);
+    visit_nodes(node->then, fn, arg);
+    visit_nodes(node->els, fn, arg);
+    visit_nodes(node->init, fn, arg);
+    visit_nodes(node->inc, fn, arg);
+    visit_nodes(node->body, fn, arg);
+    visit_nodes(node->args, fn, arg);
+  }
+}
@@ -0,0 +1,146 @@
+#include "9cc.h"
+#include <time.h>
+
+// Compile statistics for --stats and -ftime-report. Each phase records
+// wall-clock and CPU time; everything else is counted after the fact by
+// walking the token list and the AST.
+//
+// "AST bytes" is the memory held by tokens, nodes and local variables.
+// It is not every allocation: the input read from stdin, the output
+// buffer for --cache and the profile are not included.
+
+bool opt_stats;
+bool opt_stats_json;
+
+static char *phase_name[] = {"tokenize", "parse", "offsets", "codegen"};
+
+static char *node_name[] = {
+  "ND_ADD", "ND_SUB", "ND_MUL", "ND_DIV", "ND_EQ", "ND_NE", "ND_LT",
+  "ND_LE", "ND_ASSIGN", "ND_ADDR", "ND_DEREF", "ND_RETURN", "ND_IF",
+  "ND_FOR", "ND_BLOCK", "ND_FUNCALL", "ND_EXPR_STMT", "ND_VAR", "ND_NUM",
+};
+
+_Static_assert(sizeof(node_name) / sizeof(*node_name) == ND_NUM_KINDS,
+               "node_name must have one entry per NodeKind");
+
+typedef struct {
+  double wall_start;
+  double cpu_start;
+  double wall; // Seconds
+  double cpu;  // Seconds
+} Timer;
+
+static Timer timers[PH_NUM];
+static long nr_insns;
+static long nr_labels;
+
+static double now(clockid_t clk) {
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_begin(Phase ph) {
+  timers[ph].wall_start = now(CLOCK_MONOTONIC);
+  timers[ph].cpu_start = now(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void stats_end(Phase ph) {
+  timers[ph].wall += now(CLOCK_MONOTONIC) - timers[ph].wall_start;
+  timers[ph].cpu += now(CLOCK_PROCESS_CPUTIME_ID) - timers[ph].cpu_start;
+}
+
+void stats_insn(void) {
+  nr_insns++;
+}
+
+void stats_label(void) {
+  nr_labels++;
+}
+
+typedef struct {
+  long by_kind[ND_NUM_KINDS];
+  long bytes;
+} NodeCounts;
+
+static void count_node(Node *node, void *arg) {
+  NodeCounts *c = arg;
+  c->by_kind[node->kind]++;
+  c->bytes += sizeof(Node);
+  if (node->funcname)
+    c->bytes += strlen(node->funcname) + 1;
+}
+
+// Prints the statistics to stderr, as a table or as a JSON object.
+// On a cache hit nothing was compiled: `tok` and `prog` are NULL, and
+// every phase time and count is zero.
+void stats_report(char *input, Token *tok, Function *prog) {
+  bool cache_hit = !prog;
+  long nr_tokens = 0;
+  long nr_locals = 0;
+  long nr_nodes = 0;
+  long bytes = prog ? sizeof(Function) : 0;
+
+  for (Token *t = tok; t; t = t->next)
+    nr_tokens++;
+  // Tokens are allocated a whole block at a time.
+  long nr_blocks = (nr_tokens + TOKEN_BLOCK - 1) / TOKEN_BLOCK;
+  bytes += nr_blocks * TOKEN_BLOCK * sizeof(Token);
+
+  for (Var *var = prog ? prog->locals : NULL; var; var = var->next) {
+    nr_locals++;
+    bytes += sizeof(Var) + strlen(var->name) + 1;
+  }
+
+  NodeCounts counts = {};
+  if (prog)
+    visit_nodes(prog->body, count_node, &counts);
+  long *by_kind = counts.by_kind;
+  bytes += counts.bytes;
+  for (int i = 0; i < ND_NUM_KINDS; i++)
+    nr_nodes += by_kind[i];
+
+  double wall = 0, cpu = 0;
+  for (int i = 0; i < PH_NUM; i++) {
+    wall += timers[i].wall;
+    cpu += timers[i].cpu;
+  }
+
+  FILE *out = stderr;
+
+  if (opt_stats_json) {
+    fprintf(out, "{\"input_bytes\": %zu, \"cache_hit\": %s, \"phases\": {",
+            strlen(input), cache_hit ? "true" : "false");
+    for (int i = 0; i < PH_NUM; i++)
+      fprintf(out, "\"%s\": {\"wall_ms\": %.6f, \"cpu_ms\": %.6f}, ",
+              phase_name[i], timers[i].wall * 1e3, timers[i].cpu * 1e3);
+    fprintf(out, "\"total\": {\"wall_ms\": %.6f, \"cpu_ms\": %.6f}}, ",
+            wall * 1e3, cpu * 1e3);
+    fprintf(out, "\"tokens\": %ld, \"nodes\": %ld, \"nodes_by_kind\": {",
+            nr_tokens, nr_nodes);
+    for (int i = 0; i < ND_NUM_KINDS; i++)
+      fprintf(out, "%s\"%s\": %ld", i ? ", " : "", node_name[i], by_kind[i]);
+    fprintf(out, "}, \"locals\": %ld, \"instructions\": %ld, \"labels\": %ld, "
+            "\"ast_bytes\": %ld}\n",
+            nr_locals, nr_insns, nr_labels, bytes);
+    return;
+  }
+
+  fprintf(out, "%-12s %12s %12s\n", "phase", "wall (ms)", "cpu (ms)");
+  for (int i = 0; i < PH_NUM; i++)
+    fprintf(out, "%-12s %12.3f %12.3f\n",
+            phase_name[i], timers[i].wall * 1e3, timers[i].cpu * 1e3);
+  fprintf(out, "%-12s %12.3f %12.3f\n", "total", wall * 1e3, cpu * 1e3);
+  fprintf(out, "\n");
+  fprintf(out, "%-16s %ld\n", "input bytes", (long)strlen(input));
+  fprintf(out, "%-16s %s\n", "cache hit", cache_hit ? "yes" : "no");
+  fprintf(out, "%-16s %ld\n", "tokens", nr_tokens);
+  fprintf(out, "%-16s %ld\n", "nodes", nr_nodes);
+  for (int i = 0; i < ND_NUM_KINDS; i++)
+    if (by_kind[i])
+      fprintf(out, "  %-14s %ld\n", node_name[i], by_kind[i]);
+  fprintf(out, "%-16s %ld\n", "locals", nr_locals);
+  fprintf(out, "%-16s %ld\n", "instructions", nr_insns);
+  fprintf(out, "%-16s %ld\n", "labels", nr_labels);
+  fprintf(out, "%-16s %ld\n", "AST bytes", bytes);
+}
@@ -10,11 +10,23 @@ int add6(int a, int b, int c, int d, int e, int f) {
 }
 EOF
 
+# Every scanner the CPU supports must produce the same assembly as the
+# scalar one.
+lexdiff() {
+  ./9cc --lex=scalar "$1" > tmp-scalar.s || exit
+  for lex in sse2 avx2; do
+    ./9cc --lex=$lex '{ return 0; }' > /dev/null 2>&1 || continue
+    ./9cc --lex=$lex "$1" > tmp-lex.s || exit
+    cmp -s tmp-scalar.s tmp-lex.s || { echo "$1 => --lex=$lex differs"; exit 1; }
+  done
+}
+
 assert() {
   expected="$1"
   input="$2"
 
   ./9cc "$input" > tmp.s || exit
+  lexdiff "$input"
   gcc -static -o tmp tmp.s tmp2.o
   ./tmp
   actual="$?"
@@ -97,5 +109,113 @@ assert 3 '{ x=3; y=5; return *(&y-8); }'
 assert 5 '{ x=3; y=&x; *y=5; return x; }'
 assert 7 '{ x=3; y=5; *(&x+8)=7; return y; }'
 assert 7 '{ x=3; y=5; *(&y-8)=7; return x; }'
+assert 5 '{ x=3; y=5; i=1; return *(&x+i*8); }'
+assert 5 '{ x=3; y=5; i=2; return *(&x+i*4); }'
+assert 3 '{ x=3; y=5; i=2; return *(&y+i*4-16); }'
+assert 9 '{ x=3; y=5; i=1; *(&x+i*8)=9; return y; }'
+assert 5 '{ x=3; y=5; p=&x; i=1; return *(p+i*8); }'
+assert 5 '{ x=3; y=5; p=&x; return *(p+8); }'
+assert 23 '{ x=3; y=2; return x+y*4+12; }'
+assert 24 '{ x=3; y=5; return (&y+8)-&x+8; }'
+assert 7 '{ x=3; y=5; return 12 - *(&x+8); }'
+assert 6 '{ x=3; y=5; return x*2; }'
+assert 15 '{ x=3; y=5; return x*y; }'
+assert 2 '{ x=17; y=8; return x/y; }'
+assert 5 '{ x=17; return x/3; }'
+assert 3 '{ x=-3; return -x; }'
+assert 1 '{ x=0; return x==0; }'
+assert 1 '{ x=-2; return x<0; }'
+assert 0 '{ x=0; return x<0; }'
+assert 1 '{ x=0; return x<=0; }'
+assert 3 '{ x=0; if (x) return 2; return 3; }'
+assert 2 '{ x=5; if (x<=5) return 2; return 3; }'
+assert 3 '{ x=6; if (x<=5) return 2; return 3; }'
+assert 2 '{ x=5; if (x!=0) return 2; return 3; }'
+assert 1 '{ x=5000000000; return x/5000000000; }'
+assert 1 '{ x=5000000000; return x==5000000000; }'
+assert 4 '{ x=1; return (x=x+1)*(x=x+0); }'
+
+# Long identifiers, numbers and whitespace runs at every offset from a
+# 32-byte boundary, so the vector scanners cross block edges.
+long=abcdefghijklmnopqrstuvwxyz_ABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789
+for i in $(seq 0 33); do
+  lexdiff "$(printf '%*s{ %s=123456789012345;%*s\n\t return %s/1000000000000; }' \
+    $i '' $long $((i + 20)) '' $long)"
+done
+assert 123 "{ $long=123456789012345; return $long/1000000000000; }"
+assert 255 '{ return 18446744073709551615; }'
+assert 255 '{ return 18446744073709551617; }'
+assert 255 '{ return 99999999999999999999999; }'
+echo "lexer scanners => OK"
+
+# Profile-guided optimization: a profile round trip must not change the
+# result, and the profile must reach the layout decisions.
+pgo='{ s=0; for (i=0; i<5000; i=i+1) { if (i/10*10==i) s=s+1; else s=s+2; if (i<0) s=s+1000; } return s/100; }'
+rm -f tmp.prof
+./9cc --profile-generate=tmp.prof "$pgo" > tmp.s || exit
+gcc -static -o tmp tmp.s 2>/dev/null && ./tmp
+[ "$?" = 95 ] || { echo "pgo: wrong result with --profile-generate"; exit 1; }
+[ -s tmp.prof ] || { echo "pgo: no profile written"; exit 1; }
+./9cc --profile-use=tmp.prof "$pgo" > tmp.s || exit
+gcc -static -o tmp tmp.s 2>/dev/null && ./tmp
+[ "$?" = 95 ] || { echo "pgo: wrong result with --profile-use"; exit 1; }
+grep -q 'p2align' tmp.s || { echo "pgo: hot loop not aligned"; exit 1; }
+grep -q '^  j[a-z]* .L.then' tmp.s || { echo "pgo: hot else-arm does not fall through"; exit 1; }
+./9cc --profile-use=tmp.prof '{ return 0; }' 2>&1 >/dev/null | grep -q . ||
+  { echo "pgo: stale profile not reported"; exit 1; }
+echo "pgo => OK"
+
+# Compilation cache: a hit must reproduce the compiled output exactly.
+rm -rf tmp-cache
+./9cc '{ a=3; return a*2; }' > tmp.s || exit
+./9cc --cache-dir=tmp-cache '{ a=3; return a*2; }' > tmp-miss.s || exit
+./9cc --cache-dir=tmp-cache '{ a=3; return a*2; }' > tmp-hit.s || exit
+cmp -s tmp.s tmp-miss.s && cmp -s tmp.s tmp-hit.s ||
+  { echo "cache: output differs"; exit 1; }
+./9cc --cache-dir=tmp-cache --cache-stats | grep -q '^hits  *1$' ||
+  { echo "cache: expected one hit"; exit 1; }
+./9cc --cache-dir=tmp-cache --stats=json '{ a=3; return a*2; }' \
+  > tmp-hit.s 2> tmp-stats.json || exit
+cmp -s tmp-miss.s tmp-hit.s || { echo "cache: --stats changed the output"; exit 1; }
+grep -q '"cache_hit": true,.*"tokens": 0,' tmp-stats.json ||
+  { echo "cache: no --stats=json report on a hit"; exit 1; }
+for i in $(seq 1 8); do
+  ./9cc --cache-dir=tmp-cache --cache-max-size=2K "{ return $i; }" > /dev/null &
+done
+wait
+./9cc --cache-dir=tmp-cache --cache-stats | awk '/^size/ { exit $2 > 2048 }' ||
+  { echo "cache: size limit not enforced"; exit 1; }
+mkdir -p tmp-cache/00
+head -c 4096 /dev/zero > tmp-cache/00/.tmp.abcdef
+touch -d '1 hour ago' tmp-cache/00/.tmp.abcdef
+./9cc --cache-dir=tmp-cache '{ return 99; }' > /dev/null || exit
+[ ! -e tmp-cache/00/.tmp.abcdef ] ||
+  { echo "cache: stale temporary file not removed"; exit 1; }
+[ -z "$(find tmp-cache -name '*.s' ! -perm 644)" ] ||
+  { echo "cache: entries not readable by other users"; exit 1; }
+for size in '' 0 -5 5KB 99999999999G; do
+  ./9cc --cache-dir=tmp-cache --cache-max-size=$size '{ return 0; }' \
+    > /dev/null 2>&1 && { echo "cache: accepted size '$size'"; exit 1; }
+done
+rm -rf tmp-cache
+echo "cache => OK"
+
+# --stats writes to stderr and must leave the assembly unchanged.
+./9cc '{ a=3; return a+1; }' > tmp.s || exit
+./9cc --stats=json '{ a=3; return a+1; }' > tmp-stats.s 2> tmp-stats.json || exit
+cmp -s tmp.s tmp-stats.s || { echo "--stats changed the output"; exit 1; }
+grep -q '"tokens": 12,' tmp-stats.json || { echo "--stats=json: bad token count"; exit 1; }
+grep -q '"locals": 1,' tmp-stats.json || { echo "--stats=json: bad locals count"; exit 1; }
+./9cc -ftime-report '{ return 0; }' 2>&1 >/dev/null | grep -q '^codegen ' ||
+  { echo "-ftime-report: no codegen row"; exit 1; }
+echo "--stats => OK"
+
+# Line info: statements on line 3 must be attributed to line 3.
+printf '{\n  a=1;\n  return a+2;\n}\n' | ./9cc - > tmp.s || exit
+grep -q '^  .loc 1 3$' tmp.s || { echo "missing .loc for line 3"; exit 1; }
+grep -q '^.size main, .-main$' tmp.s || { echo "missing .size for main"; exit 1; }
+gcc -static -o tmp tmp.s tmp2.o && ./tmp
+[ "$?" = 3 ] || { echo "line info: wrong result"; exit 1; }
+echo "line info => OK"
 
 echo OK
@@ -1,8 +1,17 @@
 #include "9cc.h"
+#include <limits.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#include <stdint.h>
+#endif
 
 // 入力文字列
 static char *current_input;
 
+// Which scanner to use: "auto", "scalar", "sse2" or "avx2".
+char *opt_lex = "auto";
+
 //
 // Error Processings
 //
@@ -66,7 +75,15 @@ long get_number(Token *tok) {
 
 // Create a new token and add it as the next token of `cur`.
 static Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token));
+  static Token *block;
+  static int used = TOKEN_BLOCK;
+
+  if (used == TOKEN_BLOCK) {
+    block = calloc(TOKEN_BLOCK, sizeof(Token));
+    used = 0;
+  }
+
+  Token *tok = &block[used++];
   tok->kind = kind;
   tok->loc = str;
   tok->len = len;
@@ -90,6 +107,199 @@ static bool is_alnum(char c) {
   return is_alpha(c) || ('0' <= c && c <= '9');
 }
 
+//
+// Scanners
+//
+// Each scanner returns the first character at or after `p` that is not
+// in its class. The NUL terminator is in no class, so every scan stops
+// at the end of the input.
+//
+// Most tokens are a few bytes long, so the vector versions first look
+// at a few bytes one at a time and only then classify 16 or 32 bytes
+// per step. They only issue aligned loads, which never cross a page
+// boundary, so reading past the terminator is safe even though the
+// input is not padded.
+//
+
+typedef enum {
+  CL_SPACE = 1, // ' ', \t, \n, \v, \f, \r
+  CL_IDENT = 2, // [a-zA-Z0-9_]
+  CL_DIGIT = 4, // [0-9]
+} CharClass;
+
+// Bytes to check one at a time before switching to vector compares.
+#define SCALAR_PROBE 8
+
+typedef struct {
+  char *(*space)(char *p);
+  char *(*ident)(char *p);
+  char *(*digit)(char *p);
+} Scanner;
+
+static unsigned char char_class[256];
+
+static void init_char_class(void) {
+  for (int c = 0; c < 256; c++) {
+    if (c == ' ' || ('\t' <= c && c <= '\r'))
+      char_class[c] |= CL_SPACE;
+    if (is_alnum(c))
+      char_class[c] |= CL_IDENT;
+    if ('0' <= c && c <= '9')
+      char_class[c] |= CL_DIGIT;
+  }
+}
+
+static bool in_class(char c, CharClass cl) {
+  return char_class[(unsigned char)c] & cl;
+}
+
+static char *space_scalar(char *p) {
+  while (in_class(*p, CL_SPACE))
+    p++;
+  return p;
+}
+
+static char *ident_scalar(char *p) {
+  while (in_class(*p, CL_IDENT))
+    p++;
+  return p;
+}
+
+static char *digit_scalar(char *p) {
+  while (in_class(*p, CL_DIGIT))
+    p++;
+  return p;
+}
+
+static Scanner scalar_scanner = {space_scalar, ident_scalar, digit_scalar};
+
+#ifdef __x86_64__
+
+// Bytes >= 0x80 are negative as signed chars, so the signed compares
+// below never put them in a class.
+#define IN_RANGE_SSE2(v, lo, hi)                                 \
+  _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)),      \
+                _mm_cmpgt_epi8(_mm_set1_epi8((hi) + 1), v))
+
+#define IN_RANGE_AVX2(v, lo, hi)                                 \
+  _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)), \
+                   _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), v))
+
+static inline __attribute__((always_inline))
+__m128i classify_sse2(__m128i v, CharClass cl) {
+  switch (cl) {
+  case CL_SPACE:
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                        IN_RANGE_SSE2(v, '\t', '\r'));
+  case CL_IDENT:
+    return _mm_or_si128(
+      _mm_or_si128(IN_RANGE_SSE2(v, 'a', 'z'), IN_RANGE_SSE2(v, 'A', 'Z')),
+      _mm_or_si128(IN_RANGE_SSE2(v, '0', '9'),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+  default:
+    return IN_RANGE_SSE2(v, '0', '9');
+  }
+}
+
+static inline __attribute__((always_inline))
+char *scan_sse2(char *p, CharClass cl) {
+  for (int i = 0; i < SCALAR_PROBE; i++, p++)
+    if (!in_class(*p, cl))
+      return p;
+
+  int off = (uintptr_t)p & 15;
+  char *blk = p - off;
+  __m128i v = _mm_load_si128((__m128i *)blk);
+  unsigned mask = ~_mm_movemask_epi8(classify_sse2(v, cl)) & 0xFFFFu;
+  mask &= 0xFFFFu << off;
+
+  while (!mask) {
+    blk += 16;
+    v = _mm_load_si128((__m128i *)blk);
+    mask = ~_mm_movemask_epi8(classify_sse2(v, cl)) & 0xFFFFu;
+  }
+  return blk + __builtin_ctz(mask);
+}
+
+static char *space_sse2(char *p) { return scan_sse2(p, CL_SPACE); }
+static char *ident_sse2(char *p) { return scan_sse2(p, CL_IDENT); }
+static char *digit_sse2(char *p) { return scan_sse2(p, CL_DIGIT); }
+
+static Scanner sse2_scanner = {space_sse2, ident_sse2, digit_sse2};
+
+static inline __attribute__((always_inline, target("avx2")))
+__m256i classify_avx2(__m256i v, CharClass cl) {
+  switch (cl) {
+  case CL_SPACE:
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                           IN_RANGE_AVX2(v, '\t', '\r'));
+  case CL_IDENT:
+    return _mm256_or_si256(
+      _mm256_or_si256(IN_RANGE_AVX2(v, 'a', 'z'), IN_RANGE_AVX2(v, 'A', 'Z')),
+      _mm256_or_si256(IN_RANGE_AVX2(v, '0', '9'),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+  default:
+    return IN_RANGE_AVX2(v, '0', '9');
+  }
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+char *scan_avx2(char *p, CharClass cl) {
+  for (int i = 0; i < SCALAR_PROBE; i++, p++)
+    if (!in_class(*p, cl))
+      return p;
+
+  int off = (uintptr_t)p & 31;
+  char *blk = p - off;
+  __m256i v = _mm256_load_si256((__m256i *)blk);
+  unsigned mask = ~(unsigned)_mm256_movemask_epi8(classify_avx2(v, cl));
+  mask &= 0xFFFFFFFFu << off;
+
+  while (!mask) {
+    blk += 32;
+    v = _mm256_load_si256((__m256i *)blk);
+    mask = ~(unsigned)_mm256_movemask_epi8(classify_avx2(v, cl));
+  }
+  return blk + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2")))
+static char *space_avx2(char *p) { return scan_avx2(p, CL_SPACE); }
+__attribute__((target("avx2")))
+static char *ident_avx2(char *p) { return scan_avx2(p, CL_IDENT); }
+__attribute__((target("avx2")))
+static char *digit_avx2(char *p) { return scan_avx2(p, CL_DIGIT); }
+
+static Scanner avx2_scanner = {space_avx2, ident_avx2, digit_avx2};
+
+#endif
+
+// Picks a scanner according to --lex and what the CPU supports.
+static Scanner *select_scanner(void) {
+  if (!strcmp(opt_lex, "scalar"))
+    return &scalar_scanner;
+
+#ifdef __x86_64__
+  if (!strcmp(opt_lex, "sse2"))
+    return &sse2_scanner;
+
+  if (!strcmp(opt_lex, "avx2")) {
+    if (!__builtin_cpu_supports("avx2"))
+      error("--lex=avx2: このCPUはAVX2に対応していません");
+    return &avx2_scanner;
+  }
+
+  if (!strcmp(opt_lex, "auto"))
+    return __builtin_cpu_supports("avx2") ? &avx2_scanner : &sse2_scanner;
+#else
+  if (!strcmp(opt_lex, "auto"))
+    return &scalar_scanner;
+#endif
+
+  error("--lex=%s: 不明なスキャナです", opt_lex);
+  return NULL;
+}
+
 // キーワード判定
 static bool is_keyword(Token *tok) {
   static char *kw[] = {"return", "if", "else", "for", "while"};
@@ -106,34 +316,62 @@ static void convert_keywords(Token *tok) {
       t->kind = TK_RESERVED;
 }
 
+// Assigns a line number to every token. memchr jumps from one newline
+// to the next instead of looking at every byte.
+static void add_line_numbers(Token *tok) {
+  char *end = current_input + strlen(current_input);
+  char *nl = memchr(current_input, '\n', end - current_input);
+  int n = 1;
+
+  for (; tok; tok = tok->next) {
+    while (nl && nl < tok->loc) {
+      n++;
+      nl = memchr(nl + 1, '\n', end - nl - 1);
+    }
+    tok->line_no = n;
+  }
+}
+
 // 入力文字列pをトークナイズしてそれを返す
 Token *tokenize(char *p) {
   Token head = {};
   Token *cur = &head;
   current_input = p;
+  Scanner *sc = select_scanner();
+  init_char_class();
 
   while (*p) {
     // Skip whitespace characters.
-    if (isspace(*p)) {
-      p++;
+    if (in_class(*p, CL_SPACE)) {
+      p = sc->space(p + 1);
       continue;
     }
 
     // Numeric literal
-    if (isdigit(*p)) {
-      cur = new_token(TK_NUM, cur, p, 0);
+    if (in_class(*p, CL_DIGIT)) {
       char *q = p;
-      cur->val = strtoul(p, &p, 10);
-      cur->len = p - q;
+      p = sc->digit(p + 1);
+      cur = new_token(TK_NUM, cur, q, p - q);
+
+      // Too-large literals saturate to ULONG_MAX, as strtoul does.
+      unsigned long val = 0;
+      for (; q < p; q++) {
+        int d = *q - '0';
+        if (val > (ULONG_MAX - d) / 10) {
+          val = ULONG_MAX;
+          break;
+        }
+        val = val * 10 + d;
+      }
+      cur->val = val;
       continue;
     }
 
 
     // Identifier
     if (is_alpha(*p)) {
-      char *q = p++;
-      while (is_alnum(*p))
-        p++;
+      char *q = p;
+      p = sc->ident(p + 1);
       cur = new_token(TK_IDENT, cur, q, p - q);
       continue;
     }
@@ -156,6 +394,7 @@ Token *tokenize(char *p) {
   }
 
   new_token(TK_EOF, cur, p, 0);
+  add_line_numbers(head.next);
   convert_keywords(head.next);
   return head.next;
 }